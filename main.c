@@ -1,8 +1,21 @@
+// build with: cc -std=c11 -O2 -pthread main.c -lm
+#define _POSIX_C_SOURCE 200809L  //for clock_gettime, fseeko and mmap
+#define _FILE_OFFSET_BITS 64     //game record files can be larger than 2GB
+
 #include <limits.h>
 #include <stdlib.h>
 #include<stdbool.h>
 #include <stdio.h>
 #include <string.h>
+#include <strings.h>
+#include <math.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #define OFF_BOARD -2  //off-board position to check boudary condition
 #define EMPTY -1  //empty cell on the game board
@@ -12,12 +25,282 @@
 //parameters for a transposition table used for optimization. this table is used to keep records of the previous game positions.
 //Used for alpha beta pruning to skip sub tree evaluations
 
+#define BOUND_EXACT 0   //stored weight is the exact value of the position
+#define BOUND_LOWER 1   //search failed high, real value is at least the stored weight
+#define BOUND_UPPER 2   //search failed low, real value is at most the stored weight
+#define MAX_PV_LENGTH 64  //longest principal variation kept per node
+
+#define MCTS_DRAW -1            //winner value used by the Monte Carlo search for a drawn game
+#define MCTS_EXPLORATION 1.4    //UCT exploration constant, roughly sqrt(2)
+#define MCTS_MAX_THREADS 64
+#define MIN_BOARD_SIZE 4    //limits for the board size given on the command line
+#define MAX_BOARD_SIZE 20
+
+#define RECORD_MAX_MOVES (MAX_BOARD_SIZE * MAX_BOARD_SIZE)   //no game on the largest board is longer
+#define RECORD_RESULT_UNKNOWN 0         //game record results, 1 and 2 are the winning player
+#define RECORD_RESULT_DRAW 3
+#define RECORD_EMPTY_START 0x80         //set in the stored result byte when the game started on an empty board
+#define MOVE_UNSEARCHED 0               //what produced a recorded move's score: nothing (e.g. a human move),
+#define MOVE_ALPHA_BETA 1               //getWeight with 'depth' look ahead
+#define MOVE_MCTS 2                     //or Monte Carlo tree search
+#define GAME_RECORD_CHUNK_SIZE 65536    //records are written in chunks of at most this many payload bytes
+#define GAME_RECORD_FILE_MAGIC 0x52473443u   //"C4GR"
+#define GAME_RECORD_CHUNK_MAGIC 0x4B433443u  //"C4CK"
+#define GAME_RECORD_VERSION 3
+#define GAME_RECORD_HEADER_SIZE 8
+#define GAME_RECORD_CHUNK_HEADER_SIZE 16
+
+#define LOG_OFF -1       //log levels, an event is kept if its level is <= the current level
+#define LOG_ERROR 0
+#define LOG_WARN 1
+#define LOG_INFO 2
+#define LOG_DEBUG 3
+#ifndef LOG_COMPILED_LEVEL
+#define LOG_COMPILED_LEVEL LOG_DEBUG   //levels above this are removed at compile time
+#endif
+#define LOG_SINK_NONE 0
+#define LOG_SINK_STDERR 1
+#define LOG_SINK_FILE 2
+#define LOG_RING_SIZE 4096   //events buffered per thread, must be a power of two
+
+#define LOG_EVENT_ROOT_MOVE 0       //search events, see logEventFormats
+#define LOG_EVENT_BIN_OVERFLOW 1
+#define LOG_EVENT_BEST_MOVE 2
+#define LOG_EVENT_MCTS_SEARCH 3
+
+typedef struct {
+	int level;
+	int event;
+	long args[2];
+	struct timespec time;
+} LogEvent;      //one log entry. Only raw values are stored, the text is built by the logging thread.
+
+typedef struct LogRing {
+	LogEvent events[LOG_RING_SIZE];
+	atomic_uint head;        // next slot written by the owning thread
+	atomic_uint tail;        // next slot read by the logging thread
+	atomic_int in_use;       // 0 once the owning thread has exited and the ring can be reused
+	atomic_long dropped;     // events lost because the ring was full
+	int id;
+	struct LogRing* next;
+} LogRing;       //single producer, single consumer queue of events from one search thread
+
+const char* logEventFormats[] = {
+	"Move %ld has weight %ld",
+	"Overflow in hash bin %ld, won't store GameState",
+	"Best move %ld with look ahead %ld",
+	"MCTS: %ld playouts, %ld playouts/s",
+};
+const char* logLevelNames[] = {"ERROR", "WARN", "INFO", "DEBUG"};
+
+atomic_int g_log_level = LOG_OFF;
+atomic_int g_log_stop;
+int g_log_generation = 0;          // bumped by every startLogging so threads drop rings from an earlier session
+LogRing* _Atomic g_log_rings = NULL;
+int g_log_num_rings = 0;
+pthread_mutex_t g_log_ring_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_key_t g_log_key;
+pthread_t g_log_thread;
+FILE* g_log_file = NULL;
+struct timespec g_log_start;
+
+_Thread_local LogRing* t_log_ring = NULL;
+_Thread_local int t_log_generation = 0;
+
+// Logs a search event with up to two integer arguments. When 'level' is disabled this is a single compare
+// and the arguments aren't evaluated. Levels above LOG_COMPILED_LEVEL compile to nothing.
+#define LOG(level, event, a0, a1) \
+	do { \
+		if ((level) <= LOG_COMPILED_LEVEL && (level) <= atomic_load_explicit(&g_log_level, memory_order_relaxed)) \
+			logEvent((level), (event), (a0), (a1)); \
+	} while (0)
+
+//runs when a thread that logged exits, lets another thread take over its ring
+void releaseLogRing(void* ring) {
+	atomic_store(&((LogRing*) ring)->in_use, 0);
+}
+
+//finds a ring for the calling thread, reusing one left by an exited thread if possible
+LogRing* acquireLogRing() {
+	LogRing* ring;
+	int expected;
+
+	pthread_mutex_lock(&g_log_ring_lock);
+	for (ring = g_log_rings; ring != NULL; ring = ring->next) {
+		expected = 0;
+		if (atomic_compare_exchange_strong(&ring->in_use, &expected, 1))
+			break;
+	}
+
+	if (ring == NULL) {
+		ring = (LogRing*) malloc(sizeof(LogRing));
+		if (ring != NULL) {
+			atomic_init(&ring->head, 0);
+			atomic_init(&ring->tail, 0);
+			atomic_init(&ring->in_use, 1);
+			atomic_init(&ring->dropped, 0);
+			ring->id = g_log_num_rings++;
+			ring->next = g_log_rings;
+			atomic_store(&g_log_rings, ring);
+		}
+	}
+	pthread_mutex_unlock(&g_log_ring_lock);
+
+	if (ring != NULL)
+		pthread_setspecific(g_log_key, ring);
+	t_log_ring = ring;
+	t_log_generation = g_log_generation;
+	return ring;
+}
+
+//queues an event on the calling thread's ring. Never blocks: if the ring is full the event is counted as dropped.
+void logEvent(int level, int event, long a0, long a1) {
+	LogRing* ring = t_log_ring;
+	unsigned int head;
+	LogEvent* e;
+
+	if (ring == NULL || t_log_generation != g_log_generation)
+		ring = acquireLogRing();
+	if (ring == NULL)
+		return;
+
+	head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+	if (head - atomic_load_explicit(&ring->tail, memory_order_acquire) == LOG_RING_SIZE) {
+		atomic_fetch_add_explicit(&ring->dropped, 1, memory_order_relaxed);
+		return;
+	}
+
+	e = &ring->events[head & (LOG_RING_SIZE - 1)];
+	e->level = level;
+	e->event = event;
+	e->args[0] = a0;
+	e->args[1] = a1;
+	clock_gettime(CLOCK_MONOTONIC, &e->time);
+	atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+//writes out everything queued so far. Returns the number of events taken off the rings.
+int drainLogRings() {
+	LogRing* ring;
+	int count = 0;
+
+	for (ring = atomic_load(&g_log_rings); ring != NULL; ring = ring->next) {
+		unsigned int tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+		unsigned int head = atomic_load_explicit(&ring->head, memory_order_acquire);
+
+		for (; tail != head; tail++) {
+			LogEvent* e = &ring->events[tail & (LOG_RING_SIZE - 1)];
+			if (g_log_file != NULL) {
+				fprintf(g_log_file, "[%10.6f] %-5s t%d ",
+					(e->time.tv_sec - g_log_start.tv_sec) + (e->time.tv_nsec - g_log_start.tv_nsec) / 1e9,
+					logLevelNames[e->level], ring->id);
+				fprintf(g_log_file, logEventFormats[e->event], e->args[0], e->args[1]);
+				fputc('\n', g_log_file);
+			}
+			count++;
+		}
+		atomic_store_explicit(&ring->tail, tail, memory_order_release);
+	}
+
+	if (count > 0 && g_log_file != NULL)
+		fflush(g_log_file);
+	return count;
+}
+
+//background thread moving events from the rings to the sink, so the search never waits on I/O
+void* logWriter(void* arg) {
+	struct timespec pause = {0, 1000000};
+	(void) arg;
+
+	while (1) {
+		int stopping = atomic_load(&g_log_stop);
+		int count = drainLogRings();
+		if (stopping && count == 0)
+			break;
+		if (count == 0)
+			nanosleep(&pause, NULL);
+	}
+	return NULL;
+}
+
+// Starts the logging thread. Events up to 'level' go to 'sink': LOG_SINK_FILE appends to 'path',
+// LOG_SINK_STDERR writes to stderr and LOG_SINK_NONE throws them away. Call it before any search starts. Returns 0 on failure.
+int startLogging(int level, int sink, const char* path) {
+	if (atomic_load(&g_log_level) != LOG_OFF || level == LOG_OFF)
+		return level == LOG_OFF;
+
+	g_log_file = NULL;
+	if (sink == LOG_SINK_STDERR) {
+		g_log_file = stderr;
+	} else if (sink == LOG_SINK_FILE) {
+		g_log_file = fopen(path, "a");
+		if (g_log_file == NULL)
+			return 0;
+	}
+
+	if (pthread_key_create(&g_log_key, releaseLogRing) != 0)
+		goto fail;
+
+	g_log_generation++;
+	atomic_store(&g_log_stop, 0);
+	clock_gettime(CLOCK_MONOTONIC, &g_log_start);
+	if (pthread_create(&g_log_thread, NULL, logWriter, NULL) != 0) {
+		pthread_key_delete(g_log_key);
+		goto fail;
+	}
+
+	// only enable events once something is draining them
+	atomic_store(&g_log_level, level);
+	return 1;
+
+fail:
+	if (g_log_file != NULL && g_log_file != stderr)
+		fclose(g_log_file);
+	g_log_file = NULL;
+	return 0;
+}
+
+// Writes out the remaining events and stops the logging thread. Searches must have finished before this is called.
+void stopLogging() {
+	LogRing* ring;
+	long dropped = 0;
+
+	if (atomic_load(&g_log_level) == LOG_OFF)
+		return;
+
+	atomic_store(&g_log_level, LOG_OFF);
+	atomic_store(&g_log_stop, 1);
+	pthread_join(g_log_thread, NULL);
+	pthread_key_delete(g_log_key);
+
+	ring = atomic_load(&g_log_rings);
+	while (ring != NULL) {
+		LogRing* next = ring->next;
+		dropped += atomic_load(&ring->dropped);
+		free(ring);
+		ring = next;
+	}
+	atomic_store(&g_log_rings, NULL);
+	g_log_num_rings = 0;
+
+	if (g_log_file != NULL) {
+		if (dropped > 0)
+			fprintf(g_log_file, "%ld log events dropped\n", dropped);
+		if (g_log_file != stderr)
+			fclose(g_log_file);
+		else
+			fflush(g_log_file);
+	}
+	g_log_file = NULL;
+}
+
 typedef struct {
 	int width;
 	int height;
 	int* board;
 	int last_move;
 	int weight;
+	int bound;    //BOUND_* flag telling how far 'weight' can be trusted
 
 	int refs;
 } GameState;
@@ -38,6 +321,7 @@ GameState* newGameState(int width, int height) {
 	toR->height = height;
 
 	toR->weight = 0;      //stores heuristic value
+	toR->bound = BOUND_EXACT;
 	toR->refs = 1;        // number of references used for managing memory (number of ref to an object) and ensuring that resources are deallocated when not needed,
 	toR->last_move = 0;   //keep track of players moves
 
@@ -422,8 +706,8 @@ void addToTable(TranspositionTable* t, GameState* k) {
         }
     }
 
-    // If all entries in the bin are occupied, print an error message indicating overflow
-    fprintf(stderr, "Overflow in hash bin %d, won't store GameState\n", hv);
+    // If all entries in the bin are occupied, log the overflow
+    LOG(LOG_WARN, LOG_EVENT_BIN_OVERFLOW, hv, 0);
 }
 
 //releases memory for the transposition table and its bins.
@@ -455,6 +739,8 @@ typedef struct {
 	int alpha;              //alpha beta pruning
 	int beta;
 	int best_move;      // Best move found at this node
+	int pv[MAX_PV_LENGTH];   // principal variation (expected line of play) starting with best_move
+	int pv_length;
 
 	TranspositionTable* ht;
 } GameTreeNode;       //representing nodes in the game tree during AI search.
@@ -468,6 +754,7 @@ GameTreeNode* newGameTreeNode(GameState* gs, int player, int other, int turn, in
 	toR->alpha = alpha;
 	toR->beta = beta;
 	toR->best_move = -1;     // Initialize the best move to an invalid value
+	toR->pv_length = 0;
 	toR->ht = ht;
 	return toR;
 }
@@ -514,6 +801,40 @@ int desComp(const void* a, const void* b) {
 //This can be useful if you are trying to maximize your chances of winning or searching for the most favorable game states.
 
 
+//classifies a search result against the window it was searched with, so the table knows whether it is exact or only a bound
+int boundForWeight(int weight, int alpha, int beta) {
+	if (weight <= alpha)
+		return BOUND_UPPER;
+	if (weight >= beta)
+		return BOUND_LOWER;
+	return BOUND_EXACT;
+}
+
+//checks if a stored entry answers the question for the window (alpha, beta) without searching again
+int isUsableEntry(GameState* entry, int alpha, int beta) {
+	if (entry->bound == BOUND_EXACT)
+		return 1;
+	if (entry->bound == BOUND_LOWER && entry->weight >= beta)
+		return 1;
+	if (entry->bound == BOUND_UPPER && entry->weight <= alpha)
+		return 1;
+	return 0;
+}
+
+//records 'move' followed by the child's principal variation as the line expected from this node.
+//child is NULL when the weight came from the transposition table, then the line stops at 'move'.
+void updatePrincipalVariation(GameTreeNode* node, int move, GameTreeNode* child) {
+	int n = 0;
+	if (child != NULL) {
+		n = child->pv_length;
+		if (n > MAX_PV_LENGTH - 1)
+			n = MAX_PV_LENGTH - 1;
+		memcpy(node->pv + 1, child->pv, sizeof(int) * n);
+	}
+	node->pv[0] = move;
+	node->pv_length = n + 1;
+}
+
 // performs a depth-limited search of the game tree to find the best move for the AI player while considering alpha-beta pruning to minimize
 //the number of nodes that need to be explored.
 
@@ -552,39 +873,44 @@ int getWeight(GameTreeNode* node, int movesLeft) {
     for (move = 0; move < validMoves; move++) {
         // Check if the game state is already in the hash table.
         GameState* inTable = lookupInTable(node->ht, possibleMoves[move]);
+        GameTreeNode* child = NULL;
         int child_weight;
-        int child_last_move;
+        int child_last_move = possibleMoves[move]->last_move;
 
-        if (inTable != NULL) {
-            // If the game state is in the hash table, use the stored weight.
+        if (inTable != NULL && isUsableEntry(inTable, node->alpha, node->beta)) {
+            // If the stored weight is good enough for the current window, use it.
             child_weight = inTable->weight;
-            child_last_move = possibleMoves[move]->last_move;
         } else {
-            // If not in the hash table, recursively calculate the weight.
-            GameTreeNode* child = newGameTreeNode(possibleMoves[move], node->player, node->other_player, !(node->turn),
+            // Otherwise recursively calculate the weight.
+            int alpha = node->alpha;
+            int beta = node->beta;
+            child = newGameTreeNode(possibleMoves[move], node->player, node->other_player, !(node->turn),
                                                   node->alpha, node->beta, node->ht);
             child_weight = getWeight(child, movesLeft - 1);
-            child_last_move = child->gs->last_move;
-            free(child);
-        }
 
-        // Store the child's weight in the game state and hash table.
-        possibleMoves[move]->weight = child_weight;
-        addToTable(node->ht, possibleMoves[move]);
+            // Store the child's weight and how exact it is, reusing the existing table entry if there is one.
+            GameState* entry = (inTable != NULL ? inTable : possibleMoves[move]);
+            entry->weight = child_weight;
+            entry->bound = boundForWeight(child_weight, alpha, beta);
+            if (inTable == NULL)
+                addToTable(node->ht, possibleMoves[move]);
+        }
 
         if (movesLeft == LOOK_AHEAD)
-            printf("Move %d has weight %d\n", child_last_move, child_weight);
+            LOG(LOG_INFO, LOG_EVENT_ROOT_MOVE, child_last_move, child_weight);
 
         // Alpha-beta pruning for maximizing and minimizing nodes.
         if (!node->turn) {
             if (child_weight <= node->alpha) {
                 toR = child_weight;
+                free(child);
                 goto done;
             }
             node->beta = (node->beta < child_weight ? node->beta : child_weight);
         } else {
             if (child_weight >= node->beta) {
                 toR = child_weight;
+                free(child);
                 goto done;
             }
             node->alpha = (node->alpha > child_weight ? node->alpha : child_weight);
@@ -595,13 +921,16 @@ int getWeight(GameTreeNode* node, int movesLeft) {
             if (best_weight > child_weight) {
                 best_weight = child_weight;
                 node->best_move = child_last_move;
+                updatePrincipalVariation(node, child_last_move, child);
             }
         } else {
             if (best_weight < child_weight) {
                 best_weight = child_weight;
                 node->best_move = child_last_move;
+                updatePrincipalVariation(node, child_last_move, child);
             }
         }
+        free(child);
     }
     toR = best_weight;
 
@@ -642,7 +971,8 @@ void checkWin(GameState* gs) {
 }
 
 // Given a game state, this function determines the best move for a player using the minimax algorithm with alpha-beta pruning.
-int bestMoveForState(GameState* gs, int player, int other_player, int look_ahead) {
+// If 'weight' isn't NULL it receives the score of that move from the player's point of view.
+int bestMoveAndWeightForState(GameState* gs, int player, int other_player, int look_ahead, int* weight) {
 
     // Create a new transposition table for caching game states.
     TranspositionTable* t1 = newTable();
@@ -651,7 +981,11 @@ int bestMoveForState(GameState* gs, int player, int other_player, int look_ahead
     GameTreeNode* n = newGameTreeNode(gs, player, other_player, 1, INT_MIN, INT_MAX, t1);
 
     // Get the best move using the minimax algorithm with alpha-beta pruning.
-    int move = getBestMove(n, look_ahead);
+    int best_weight = getWeight(n, look_ahead);
+    int move = n->best_move;
+    LOG(LOG_INFO, LOG_EVENT_BEST_MOVE, move, look_ahead);
+    if (weight != NULL)
+        *weight = best_weight;
 
     // Free memory allocated for the game tree node and transposition table.
     free(n);
@@ -661,6 +995,10 @@ int bestMoveForState(GameState* gs, int player, int other_player, int look_ahead
     return move;
 }
 
+int bestMoveForState(GameState* gs, int player, int other_player, int look_ahead) {
+    return bestMoveAndWeightForState(gs, player, other_player, look_ahead, NULL);
+}
+
 int canMove(GameState* gs, int column) {
     int y;
     for (y = 0; y < gs->height; y++) {
@@ -671,20 +1009,1282 @@ int canMove(GameState* gs, int column) {
     return 0;
 }
 
+typedef struct {
+	int move;                 // root column
+	int score;                // exact minimax score from the analysing player's point of view
+	int pv[MAX_PV_LENGTH];    // principal variation, pv[0] == move
+	int pv_length;
+	int pv_complete;          // 1 if the line reaches the search depth or the end of the game
+} RootMoveAnalysis;       //one scored root move returned by analyzeState
+
+// A line stops where the search took a position's weight from the transposition table. This replays the line
+// and searches again from its last position, which is cheap because the table is shared, until the line is
+// 'look_ahead' moves long or the game is over.
+void extendPrincipalVariation(GameState* gs, int player, int other_player, int look_ahead, RootMoveAnalysis* a, TranspositionTable* t) {
+	int i, added;
+	GameState* end = stateForMove(gs, a->pv[0], player);
+
+	a->pv_complete = 0;
+	if (end == NULL)
+		return;
+	for (i = 1; i < a->pv_length; i++) {
+		drop(end, a->pv[i], (i % 2 ? other_player : player));
+	}
+
+	while (a->pv_length < MAX_PV_LENGTH) {
+		if (a->pv_length >= look_ahead || getWinner(end) || isDraw(end)) {
+			a->pv_complete = 1;
+			break;
+		}
+
+		// after an even number of moves it is the analysing player's turn again
+		GameTreeNode* n = newGameTreeNode(end, player, other_player, a->pv_length % 2 == 0, INT_MIN, INT_MAX, t);
+		getWeight(n, look_ahead - a->pv_length);
+		for (added = 0; added < n->pv_length && a->pv_length < MAX_PV_LENGTH; added++) {
+			drop(end, n->pv[added], (a->pv_length % 2 ? other_player : player));
+			a->pv[a->pv_length++] = n->pv[added];
+		}
+		free(n);
+
+		if (added == 0)
+			break;
+	}
+
+	freeGameState(end);
+}
+
+// Scores the best 'num_pv' root moves for 'player' in a single search and writes them to 'out' sorted best first.
+// All root moves share one transposition table. Once 'out' is full the remaining moves are searched with the
+// weakest kept score as alpha, so moves that can't make the list fail low cheaply while the kept scores stay exact.
+// Returns the number of entries written (0 if the game is already over).
+int analyzeState(GameState* gs, int player, int other_player, int look_ahead, int num_pv, RootMoveAnalysis* out) {
+	int column, i, found = 0;
+
+	if (num_pv <= 0 || look_ahead <= 0 || getWinner(gs) || isDraw(gs))
+		return 0;
+
+	// Create a transposition table shared by every root move.
+	TranspositionTable* t1 = newTable();
+
+	for (column = 0; column < gs->width; column++) {
+		if (!canMove(gs, column))
+			continue;
+
+		int alpha = (found == num_pv ? out[found - 1].score : INT_MIN);
+		GameState* child_state = stateForMove(gs, column, player);
+		GameTreeNode* child = newGameTreeNode(child_state, player, other_player, 0, alpha, INT_MAX, t1);
+		int score = getWeight(child, look_ahead - 1);
+
+		if (score > alpha) {
+			// Insert into the sorted list, dropping the weakest entry if it is full.
+			int pos = (found < num_pv ? found++ : num_pv - 1);
+			while (pos > 0 && out[pos - 1].score < score) {
+				out[pos] = out[pos - 1];
+				pos--;
+			}
+
+			out[pos].move = column;
+			out[pos].score = score;
+			out[pos].pv[0] = column;
+			out[pos].pv_length = 1;
+			for (i = 0; i < child->pv_length && i < MAX_PV_LENGTH - 1; i++) {
+				out[pos].pv[i + 1] = child->pv[i];
+				out[pos].pv_length++;
+			}
+		}
+
+		free(child);
+		freeGameState(child_state);
+	}
+
+	for (i = 0; i < found; i++) {
+		extendPrincipalVariation(gs, player, other_player, look_ahead, &out[i], t1);
+	}
+
+	freeTranspositionTable(t1);
+	return found;
+}
+
+//prints the result of analyzeState, one root move per line
+void printAnalysis(RootMoveAnalysis* moves, int count) {
+	int i, j;
+	for (i = 0; i < count; i++) {
+		printf("Move %d score %d pv:", moves[i].move, moves[i].score);
+		for (j = 0; j < moves[i].pv_length; j++) {
+			printf(" %d", moves[i].pv[j]);
+		}
+		printf(moves[i].pv_complete ? "\n" : " ...\n");
+	}
+}
+
+//returns the row of the top piece in 'column', or -1 if the column is empty
+int topRow(GameState* gs, int column) {
+	int y;
+	for (y = gs->height - 1; y >= 0; y--) {
+		if (at(gs, column, y) != EMPTY)
+			return y;
+	}
+	return -1;
+}
+
+//checks whether the piece on top of 'column' completes four in a row.
+//Only the lines through that piece are looked at, so this is much cheaper than getWinner after a single drop.
+int dropWins(GameState* gs, int column) {
+	static const int dirs[4][2] = {{1, 0}, {0, 1}, {1, 1}, {1, -1}};
+	int y = topRow(gs, column);
+	int piece = at(gs, column, y);
+	int d, i, count;
+
+	for (d = 0; d < 4; d++) {
+		count = 1;
+		for (i = 1; at(gs, column + i * dirs[d][0], y + i * dirs[d][1]) == piece; i++)
+			count++;
+		for (i = 1; at(gs, column - i * dirs[d][0], y - i * dirs[d][1]) == piece; i++)
+			count++;
+		if (count >= 4)
+			return 1;
+	}
+	return 0;
+}
+
+//takes back the top piece of 'column'
+void undoDrop(GameState* gs, int column) {
+	gs->board[column * gs->height + topRow(gs, column)] = EMPTY;
+}
+
+typedef struct {
+	atomic_int visits;
+	atomic_int wins;           // in half points (win = 2, draw = 1) for the player who moved into this node
+	atomic_int virtual_loss;   // threads currently walking through this node
+	atomic_int expanded;       // 0 = leaf, 1 = being expanded, 2 = children ready, 3 = leaf for good because the pool is full
+	int move;                  // column played to reach this node
+	int first_child;           // index of the first child in the pool
+	int num_children;
+} MCTSNode;      //node of the Monte Carlo search tree. Children are stored next to each other in the pool.
+
+typedef struct {
+	long playouts;      // stop after this many playouts, 0 for no limit
+	int time_ms;        // stop after this many milliseconds, 0 for no limit
+	int threads;        // number of search threads
+	int node_capacity;  // size of the node pool, the tree stops growing when it is full
+} MCTSParams;
+
+typedef struct {
+	int move;
+	int score;          // win rate of the move scaled to -1000 (always lost) .. 1000 (always won)
+	long playouts;
+	double seconds;
+	double playouts_per_second;
+} MCTSResult;
+
+typedef struct {
+	MCTSNode* nodes;      // node pool, nodes[0] is the root
+	atomic_int used;
+	int capacity;
+
+	GameState* root;
+	int player;           // player to move at the root
+	int other_player;
+	int root_filled;      // pieces on the board at the root
+
+	atomic_long playouts;
+	long playout_budget;
+	struct timespec start;
+	int time_ms;
+	atomic_int stop;
+} MCTSTree;       //tree shared by all search threads
+
+typedef struct {
+	MCTSTree* tree;
+	unsigned long long rng;
+} MCTSWorker;
+
+//xorshift random number generator, one state per thread
+unsigned int nextRandom(unsigned long long* state) {
+	unsigned long long x = *state;
+	x ^= x << 13;
+	x ^= x >> 7;
+	x ^= x << 17;
+	*state = x;
+	return (unsigned int) (x >> 32);
+}
+
+double secondsSince(struct timespec* start) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+//creates the children of a leaf for every legal column. Returns 0 if another thread is already doing it or the pool is full.
+int expandNode(MCTSTree* tree, MCTSNode* node, GameState* gs) {
+	int expected = 0;
+	int column, count = 0, first, i;
+
+	if (!atomic_compare_exchange_strong(&node->expanded, &expected, 1))
+		return 0;
+
+	for (column = 0; column < gs->width; column++) {
+		if (canMove(gs, column))
+			count++;
+	}
+
+	// only reserve the nodes if they all fit, so 'used' never goes past the capacity
+	first = atomic_load(&tree->used);
+	do {
+		if (first + count > tree->capacity) {
+			atomic_store(&node->expanded, 3);
+			return 0;
+		}
+	} while (!atomic_compare_exchange_weak(&tree->used, &first, first + count));
+
+	i = first;
+	for (column = 0; column < gs->width; column++) {
+		if (!canMove(gs, column))
+			continue;
+		atomic_init(&tree->nodes[i].visits, 0);
+		atomic_init(&tree->nodes[i].wins, 0);
+		atomic_init(&tree->nodes[i].virtual_loss, 0);
+		atomic_init(&tree->nodes[i].expanded, 0);
+		tree->nodes[i].move = column;
+		tree->nodes[i].first_child = -1;
+		tree->nodes[i].num_children = 0;
+		i++;
+	}
+
+	node->first_child = first;
+	node->num_children = count;
+	atomic_store_explicit(&node->expanded, 2, memory_order_release);
+	return 1;
+}
+
+//picks the child with the highest UCT value. Virtual losses count as visits without wins, which pushes
+//other threads towards different lines while a playout through this node is still running.
+int selectChild(MCTSTree* tree, MCTSNode* node) {
+	int i, best = node->first_child;
+	double best_value = -1;
+	int parent_visits = atomic_load_explicit(&node->visits, memory_order_relaxed) +
+		atomic_load_explicit(&node->virtual_loss, memory_order_relaxed);
+	double log_parent = log(parent_visits + 1);
+
+	for (i = node->first_child; i < node->first_child + node->num_children; i++) {
+		MCTSNode* child = &tree->nodes[i];
+		int visits = atomic_load_explicit(&child->visits, memory_order_relaxed) +
+			atomic_load_explicit(&child->virtual_loss, memory_order_relaxed);
+		double value;
+
+		if (visits == 0)
+			return i;     // always try unvisited moves first
+
+		value = atomic_load_explicit(&child->wins, memory_order_relaxed) / (2.0 * visits) +
+			MCTS_EXPLORATION * sqrt(log_parent / visits);
+		if (value > best_value) {
+			best_value = value;
+			best = i;
+		}
+	}
+	return best;
+}
+
+//plays random moves until the game ends, always taking an immediate win when there is one. Returns the winner or MCTS_DRAW.
+int playout(GameState* gs, int to_move, int other, int filled, int* legal, unsigned long long* rng) {
+	int column, count, tmp;
+
+	while (filled < gs->width * gs->height) {
+		count = 0;
+		for (column = 0; column < gs->width; column++) {
+			if (!canMove(gs, column))
+				continue;
+			drop(gs, column, to_move);
+			if (dropWins(gs, column))
+				return to_move;
+			undoDrop(gs, column);
+			legal[count++] = column;
+		}
+
+		drop(gs, legal[nextRandom(rng) % count], to_move);
+		filled++;
+
+		tmp = to_move;
+		to_move = other;
+		other = tmp;
+	}
+
+	return MCTS_DRAW;
+}
+
+//one search thread: select, expand, play out and back up until the budget runs out
+void* mctsWorker(void* arg) {
+	MCTSWorker* worker = (MCTSWorker*) arg;
+	MCTSTree* tree = worker->tree;
+	GameState* gs = newGameState(tree->root->width, tree->root->height);
+	int cells = gs->width * gs->height;
+	int* path = (int*) malloc(sizeof(int) * (cells + 1));
+	int* legal = (int*) malloc(sizeof(int) * gs->width);
+
+	while (!atomic_load_explicit(&tree->stop, memory_order_relaxed)) {
+		int depth = 0, winner = 0, i;
+		int to_move = tree->player, other = tree->other_player, tmp;
+		int filled = tree->root_filled;
+		MCTSNode* node = &tree->nodes[0];
+
+		memcpy(gs->board, tree->root->board, sizeof(int) * cells);
+		path[0] = 0;
+		atomic_fetch_add(&node->virtual_loss, 1);
+
+		// Selection and expansion.
+		while (1) {
+			if (atomic_load_explicit(&node->expanded, memory_order_acquire) != 2) {
+				if (atomic_load_explicit(&node->visits, memory_order_relaxed) == 0 || !expandNode(tree, node, gs))
+					break;
+			}
+
+			int c = selectChild(tree, node);
+			node = &tree->nodes[c];
+			path[++depth] = c;
+			atomic_fetch_add(&node->virtual_loss, 1);
+
+			drop(gs, node->move, to_move);
+			filled++;
+			if (dropWins(gs, node->move)) {
+				winner = to_move;
+				break;
+			}
+			if (filled == cells) {
+				winner = MCTS_DRAW;
+				break;
+			}
+
+			tmp = to_move;
+			to_move = other;
+			other = tmp;
+		}
+
+		// Simulation.
+		if (winner == 0)
+			winner = playout(gs, to_move, other, filled, legal, &worker->rng);
+
+		// Backpropagation, rewarding each node from the point of view of the player who moved into it.
+		for (i = depth; i >= 0; i--) {
+			MCTSNode* n = &tree->nodes[path[i]];
+			int mover = (i % 2 ? tree->player : tree->other_player);
+			atomic_fetch_add(&n->wins, (winner == mover ? 2 : (winner == MCTS_DRAW ? 1 : 0)));
+			atomic_fetch_add(&n->visits, 1);
+			atomic_fetch_sub(&n->virtual_loss, 1);
+		}
+
+		long done = atomic_fetch_add(&tree->playouts, 1) + 1;
+		if (tree->playout_budget > 0 && done >= tree->playout_budget)
+			atomic_store(&tree->stop, 1);
+		if (tree->time_ms > 0 && done % 64 == 0 && secondsSince(&tree->start) * 1000 >= tree->time_ms)
+			atomic_store(&tree->stop, 1);
+	}
+
+	free(legal);
+	free(path);
+	freeGameState(gs);
+	return NULL;
+}
+
+// Finds a move for 'player' with Monte Carlo tree search (UCT) instead of alpha-beta.
+// Runs params->threads threads on one shared tree until the playout or time budget is used up
+// and plays the most visited root move. At least one of the budgets must be set.
+// Fills 'result' (if not NULL) and returns the move, or -1 if the game is over or the search couldn't run.
+int mctsBestMoveForState(GameState* gs, int player, int other_player, MCTSParams* params, MCTSResult* result) {
+	MCTSTree tree;
+	MCTSWorker workers[MCTS_MAX_THREADS];
+	pthread_t threads[MCTS_MAX_THREADS];
+	int i, num_threads, started, best = -1, best_visits = -1, best_wins = 0, x, y;
+
+	if (getWinner(gs) || isDraw(gs))
+		return -1;
+
+	// without a budget the search would never stop
+	if (params->playouts <= 0 && params->time_ms <= 0)
+		return -1;
+
+	num_threads = params->threads;
+	if (num_threads < 1)
+		num_threads = 1;
+	if (num_threads > MCTS_MAX_THREADS)
+		num_threads = MCTS_MAX_THREADS;
+
+	tree.capacity = (params->node_capacity > gs->width ? params->node_capacity : gs->width + 1);
+	tree.nodes = (MCTSNode*) malloc(sizeof(MCTSNode) * tree.capacity);
+	if (tree.nodes == NULL)
+		return -1;
+	atomic_init(&tree.used, 1);
+	atomic_init(&tree.nodes[0].visits, 1);
+	atomic_init(&tree.nodes[0].wins, 0);
+	atomic_init(&tree.nodes[0].virtual_loss, 0);
+	atomic_init(&tree.nodes[0].expanded, 0);
+	tree.nodes[0].move = -1;
+
+	tree.root = gs;
+	tree.player = player;
+	tree.other_player = other_player;
+	tree.root_filled = 0;
+	for (x = 0; x < gs->width; x++) {
+		for (y = 0; y < gs->height; y++) {
+			if (at(gs, x, y) != EMPTY)
+				tree.root_filled++;
+		}
+	}
+
+	atomic_init(&tree.playouts, 0);
+	tree.playout_budget = (params->playouts > 0 ? params->playouts : 0);
+	tree.time_ms = (params->time_ms > 0 ? params->time_ms : 0);
+	atomic_init(&tree.stop, 0);
+	clock_gettime(CLOCK_MONOTONIC, &tree.start);
+
+	// Expand the root up front so every thread starts with moves to choose from.
+	expandNode(&tree, &tree.nodes[0], gs);
+
+	for (i = 0; i < num_threads; i++) {
+		workers[i].tree = &tree;
+		workers[i].rng = 0x9E3779B97F4A7C15ULL * (i + 1) ^ (unsigned long long) tree.start.tv_nsec;
+		if (workers[i].rng == 0)
+			workers[i].rng = 1;
+	}
+
+	// Start as many threads as we can. If none start, search on this thread instead.
+	for (started = 0; started < num_threads; started++) {
+		if (pthread_create(&threads[started], NULL, mctsWorker, &workers[started]) != 0)
+			break;
+	}
+	if (started == 0)
+		mctsWorker(&workers[0]);
+	for (i = 0; i < started; i++) {
+		pthread_join(threads[i], NULL);
+	}
+
+	for (i = tree.nodes[0].first_child; i < tree.nodes[0].first_child + tree.nodes[0].num_children; i++) {
+		int visits = atomic_load(&tree.nodes[i].visits);
+		if (visits > best_visits) {
+			best_visits = visits;
+			best_wins = atomic_load(&tree.nodes[i].wins);
+			best = tree.nodes[i].move;
+		}
+	}
+
+	long playouts = atomic_load(&tree.playouts);
+	double seconds = secondsSince(&tree.start);
+	double playouts_per_second = (seconds > 0 ? playouts / seconds : 0);
+	LOG(LOG_DEBUG, LOG_EVENT_MCTS_SEARCH, playouts, (long) playouts_per_second);
+
+	if (result != NULL) {
+		result->move = best;
+		result->score = (best_visits > 0 ? (int) (1000.0 * (best_wins - best_visits) / best_visits) : 0);
+		result->playouts = playouts;
+		result->seconds = seconds;
+		result->playouts_per_second = playouts_per_second;
+	}
+
+	free(tree.nodes);
+	return best;
+}
+
+// Packs a position into 64 bits. Each column takes height+1 bits: one bit per piece from the bottom up
+// (0 = player 1, 1 = player 2) followed by a 1 marking the top of the column. The bit above all columns is set
+// when player 2 is to move. Boards need (height+1)*width+1 <= 64 bits, which includes 7x6.
+// Returns 0 if the board is too big to pack.
+int encodePosition(GameState* gs, int to_move, unsigned long long* out) {
+	unsigned long long code = 0;
+	int x, y, bit = 0;
+
+	if ((gs->height + 1) * gs->width + 1 > 64)
+		return 0;
+
+	for (x = 0; x < gs->width; x++) {
+		for (y = 0; y < gs->height && at(gs, x, y) != EMPTY; y++) {
+			if (at(gs, x, y) == 2)
+				code |= 1ULL << (bit + y);
+		}
+		code |= 1ULL << (bit + y);      // top of column marker
+		bit += gs->height + 1;
+	}
+	if (to_move == 2)
+		code |= 1ULL << bit;
+
+	*out = code;
+	return 1;
+}
+
+//unpacks a position made by encodePosition into a new GameState. Returns NULL if the code doesn't fit the board size.
+GameState* decodePosition(unsigned long long code, int width, int height, int* to_move) {
+	GameState* toR;
+	int x, y, top, bit = 0;
+
+	if ((height + 1) * width + 1 > 64)
+		return NULL;
+
+	toR = newGameState(width, height);
+	if (toR == NULL)
+		return NULL;
+
+	for (x = 0; x < width; x++) {
+		// the marker is the highest set bit of the column
+		for (top = height; top > 0 && !(code & (1ULL << (bit + top))); top--)
+			;
+		if (!(code & (1ULL << (bit + top)))) {
+			freeGameState(toR);
+			return NULL;
+		}
+		for (y = 0; y < top; y++) {
+			toR->board[x * height + y] = ((code >> (bit + y)) & 1) ? 2 : 1;
+		}
+		bit += height + 1;
+	}
+
+	if (to_move != NULL)
+		*to_move = ((code >> bit) & 1) ? 2 : 1;
+	return toR;
+}
+
+typedef struct {
+	int column;
+	int engine;    // MOVE_* telling which search, if any, produced the score
+	int score;     // search score for the move, from the mover's point of view
+	int depth;     // look ahead of the alpha-beta search, 0 for other engines
+} MoveAnnotation;
+
+typedef struct {
+	int empty_start;            // 1 if the game started on an empty board, 'start' is unused then
+	unsigned long long start;   // packed start position, see encodePosition. Only boards up to 7x7 and 9x6 fit.
+	int result;                 // RECORD_RESULT_* or the winning player
+	int num_moves;
+	MoveAnnotation moves[RECORD_MAX_MOVES];
+} GameRecord;
+
+// Game record file layout, all integers little endian:
+//   header: u32 magic "C4GR", u8 version, u8 width, u8 height, u8 reserved
+//   chunks: u32 magic "C4CK", u32 record count, u32 payload bytes, u32 payload checksum, payload
+//   record: u64 start position, u8 result (| RECORD_EMPTY_START), u16 move count,
+//           then per move u8 column (low 6 bits) | engine << 6, u8 depth, i16 score
+// The file is only ever appended to. The readers stop at a chunk that is cut short or fails its checksum,
+// and the writer cuts off an incomplete last chunk before appending.
+
+void putU16(unsigned char* p, unsigned int v) {
+	p[0] = v & 0xFF;
+	p[1] = (v >> 8) & 0xFF;
+}
+
+void putU32(unsigned char* p, unsigned long v) {
+	putU16(p, v & 0xFFFF);
+	putU16(p + 2, (v >> 16) & 0xFFFF);
+}
+
+unsigned int getU16(const unsigned char* p) {
+	return p[0] | (p[1] << 8);
+}
+
+unsigned long getU32(const unsigned char* p) {
+	return getU16(p) | ((unsigned long) getU16(p + 2) << 16);
+}
+
+//number of bytes a record takes on disk
+int gameRecordSize(GameRecord* r) {
+	return 11 + 4 * r->num_moves;
+}
+
+//writes a record to 'p', which must have room for gameRecordSize bytes
+void serializeGameRecord(GameRecord* r, unsigned char* p) {
+	int i;
+	putU32(p, r->start & 0xFFFFFFFFu);
+	putU32(p + 4, r->start >> 32);
+	p[8] = r->result | (r->empty_start ? RECORD_EMPTY_START : 0);
+	putU16(p + 9, r->num_moves);
+	for (i = 0; i < r->num_moves; i++) {
+		p[11 + 4 * i] = (r->moves[i].column & 0x3F) | (r->moves[i].engine << 6);
+		p[12 + 4 * i] = (r->moves[i].depth < 255 ? r->moves[i].depth : 255);
+		int score = r->moves[i].score;
+		if (score > SHRT_MAX)
+			score = SHRT_MAX;
+		if (score < SHRT_MIN)
+			score = SHRT_MIN;
+		putU16(p + 13 + 4 * i, (unsigned int) (score & 0xFFFF));
+	}
+}
+
+//reads one record from at most 'avail' bytes. Returns the bytes used, or 0 if the data is cut short or invalid.
+int parseGameRecord(const unsigned char* p, long avail, GameRecord* r) {
+	int i;
+	if (avail < 11)
+		return 0;
+	r->start = getU32(p) | ((unsigned long long) getU32(p + 4) << 32);
+	r->empty_start = (p[8] & RECORD_EMPTY_START) != 0;
+	r->result = p[8] & ~RECORD_EMPTY_START;
+	r->num_moves = getU16(p + 9);
+	if (r->num_moves > RECORD_MAX_MOVES || avail < gameRecordSize(r))
+		return 0;
+	for (i = 0; i < r->num_moves; i++) {
+		r->moves[i].column = p[11 + 4 * i] & 0x3F;
+		r->moves[i].engine = p[11 + 4 * i] >> 6;
+		r->moves[i].depth = p[12 + 4 * i];
+		r->moves[i].score = (short) getU16(p + 13 + 4 * i);
+	}
+	return gameRecordSize(r);
+}
+
+//builds the position a record starts from. Returns NULL if it can't be decoded for this board size.
+GameState* startOfGameRecord(GameRecord* r, int width, int height, int* to_move) {
+	if (r->empty_start) {
+		if (to_move != NULL)
+			*to_move = 1;
+		return newGameState(width, height);
+	}
+	return decodePosition(r->start, width, height, to_move);
+}
+
+//checks the 8 byte file header and reads the board size from it
+int parseGameRecordHeader(const unsigned char* p, int* width, int* height) {
+	if (getU32(p) != GAME_RECORD_FILE_MAGIC || p[4] != GAME_RECORD_VERSION)
+		return 0;
+	*width = p[5];
+	*height = p[6];
+	return 1;
+}
+
+//checksum of a chunk payload (32 bit FNV-1a, the 32 bit version of the hash used by hashGameState)
+unsigned long chunkChecksum(const unsigned char* p, size_t size) {
+	unsigned long hash = 2166136261u;
+	size_t i;
+	for (i = 0; i < size; i++) {
+		hash ^= p[i];
+		hash = (hash * 16777619u) & 0xFFFFFFFFu;
+	}
+	return hash;
+}
+
+typedef struct {
+	FILE* f;
+	int width;
+	int height;
+	unsigned char* chunk;    // records not yet written out
+	int chunk_used;
+	int chunk_records;
+} GameRecordWriter;       //appends game records to a file one chunk at a time
+
+//writes a fresh file header at the start of an empty file
+int writeGameRecordHeader(FILE* f, int width, int height) {
+	unsigned char header[GAME_RECORD_HEADER_SIZE];
+	putU32(header, GAME_RECORD_FILE_MAGIC);
+	header[4] = GAME_RECORD_VERSION;
+	header[5] = width;
+	header[6] = height;
+	header[7] = 0;
+	return fwrite(header, 1, sizeof(header), f) == sizeof(header);
+}
+
+// Finds where the last good chunk of an open record file ends. The chunk headers are walked to find the last
+// complete chunk, and that one's checksum is checked too since a crash can leave it full length but not written.
+// 'scratch' must hold GAME_RECORD_CHUNK_SIZE bytes.
+off_t endOfCompleteChunks(FILE* f, off_t size, unsigned char* scratch) {
+	unsigned char header[GAME_RECORD_CHUNK_HEADER_SIZE];
+	unsigned char last_header[GAME_RECORD_CHUNK_HEADER_SIZE];
+	off_t pos = GAME_RECORD_HEADER_SIZE;
+	off_t last = -1;
+
+	while (pos + GAME_RECORD_CHUNK_HEADER_SIZE <= size) {
+		off_t next;
+		if (fseeko(f, pos, SEEK_SET) != 0 || fread(header, 1, sizeof(header), f) != sizeof(header) ||
+			getU32(header) != GAME_RECORD_CHUNK_MAGIC || getU32(header + 8) > GAME_RECORD_CHUNK_SIZE)
+			break;
+		next = pos + GAME_RECORD_CHUNK_HEADER_SIZE + (off_t) getU32(header + 8);
+		if (next > size)
+			break;
+		memcpy(last_header, header, sizeof(header));
+		last = pos;
+		pos = next;
+	}
+
+	if (last >= 0) {
+		size_t payload = getU32(last_header + 8);
+		if (fseeko(f, last + GAME_RECORD_CHUNK_HEADER_SIZE, SEEK_SET) != 0 ||
+			fread(scratch, 1, payload, f) != payload ||
+			chunkChecksum(scratch, payload) != getU32(last_header + 12))
+			pos = last;
+	}
+	return pos;
+}
+
+// Opens 'path' for appending game records, creating it if needed. An existing file must be for the same board size.
+// A last chunk left incomplete or damaged by an earlier crash is cut off so new chunks follow the last good one.
+GameRecordWriter* openGameRecordWriter(const char* path, int width, int height) {
+	unsigned char header[GAME_RECORD_HEADER_SIZE];
+	int file_width, file_height;
+	off_t size, end;
+	GameRecordWriter* toR = (GameRecordWriter*) malloc(sizeof(GameRecordWriter));
+	if (toR == NULL)
+		return NULL;
+
+	toR->chunk = (unsigned char*) malloc(GAME_RECORD_CHUNK_SIZE);
+	toR->f = fopen(path, "a+b");
+	if (toR->chunk == NULL || toR->f == NULL)
+		goto fail;
+
+	toR->width = width;
+	toR->height = height;
+	toR->chunk_used = 0;
+	toR->chunk_records = 0;
+
+	fseeko(toR->f, 0, SEEK_END);
+	size = ftello(toR->f);
+	if (size < GAME_RECORD_HEADER_SIZE) {
+		// new file, or one whose header never got written completely
+		if ((size > 0 && ftruncate(fileno(toR->f), 0) != 0) || !writeGameRecordHeader(toR->f, width, height))
+			goto fail;
+	} else {
+		fseeko(toR->f, 0, SEEK_SET);
+		if (fread(header, 1, sizeof(header), toR->f) != sizeof(header) ||
+			!parseGameRecordHeader(header, &file_width, &file_height) ||
+			file_width != width || file_height != height) {
+			fprintf(stderr, "%s is not a game record file for a %dx%d board\n", path, width, height);
+			goto fail;
+		}
+
+		end = endOfCompleteChunks(toR->f, size, toR->chunk);
+		if (end < size && ftruncate(fileno(toR->f), end) != 0)
+			goto fail;
+
+		// switching from reading to writing needs a positioning call in between
+		fseeko(toR->f, 0, SEEK_END);
+	}
+
+	return toR;
+
+fail:
+	if (toR->f != NULL)
+		fclose(toR->f);
+	free(toR->chunk);
+	free(toR);
+	return NULL;
+}
+
+//writes the buffered records out as one chunk. Returns 0 on a write error.
+int flushGameRecordWriter(GameRecordWriter* w) {
+	unsigned char header[GAME_RECORD_CHUNK_HEADER_SIZE];
+
+	if (w->chunk_records == 0)
+		return 1;
+
+	putU32(header, GAME_RECORD_CHUNK_MAGIC);
+	putU32(header + 4, w->chunk_records);
+	putU32(header + 8, w->chunk_used);
+	putU32(header + 12, chunkChecksum(w->chunk, w->chunk_used));
+	if (fwrite(header, 1, sizeof(header), w->f) != sizeof(header) ||
+		fwrite(w->chunk, 1, w->chunk_used, w->f) != (size_t) w->chunk_used ||
+		fflush(w->f) != 0)
+		return 0;
+
+	w->chunk_used = 0;
+	w->chunk_records = 0;
+	return 1;
+}
+
+//adds a record, writing a chunk out first if it has no room left. Returns 0 on error.
+int writeGameRecord(GameRecordWriter* w, GameRecord* r) {
+	int i;
+	if (r->num_moves < 0 || r->num_moves > RECORD_MAX_MOVES)
+		return 0;
+	for (i = 0; i < r->num_moves; i++) {
+		if (r->moves[i].column < 0 || r->moves[i].column > 0x3F || r->moves[i].engine < 0 || r->moves[i].engine > 3)
+			return 0;
+	}
+
+	if (w->chunk_used + gameRecordSize(r) > GAME_RECORD_CHUNK_SIZE && !flushGameRecordWriter(w))
+		return 0;
+
+	serializeGameRecord(r, w->chunk + w->chunk_used);
+	w->chunk_used += gameRecordSize(r);
+	w->chunk_records++;
+	return 1;
+}
+
+//flushes the last chunk and closes the file. Returns 0 if anything failed to write.
+int closeGameRecordWriter(GameRecordWriter* w) {
+	int ok = flushGameRecordWriter(w);
+	if (fclose(w->f) != 0)
+		ok = 0;
+	free(w->chunk);
+	free(w);
+	return ok;
+}
+
+typedef struct {
+	FILE* f;
+	int width;
+	int height;
+	unsigned char* chunk;    // current chunk, only one is held in memory at a time
+	int chunk_size;
+	int chunk_pos;
+	int chunk_records_left;
+} GameRecordReader;       //reads game records front to back without loading the whole file
+
+GameRecordReader* openGameRecordReader(const char* path) {
+	unsigned char header[GAME_RECORD_HEADER_SIZE];
+	GameRecordReader* toR = (GameRecordReader*) malloc(sizeof(GameRecordReader));
+	if (toR == NULL)
+		return NULL;
+
+	toR->chunk = (unsigned char*) malloc(GAME_RECORD_CHUNK_SIZE);
+	toR->f = fopen(path, "rb");
+	if (toR->chunk == NULL || toR->f == NULL ||
+		fread(header, 1, sizeof(header), toR->f) != sizeof(header) ||
+		!parseGameRecordHeader(header, &toR->width, &toR->height)) {
+		if (toR->f != NULL)
+			fclose(toR->f);
+		free(toR->chunk);
+		free(toR);
+		return NULL;
+	}
+
+	toR->chunk_size = 0;
+	toR->chunk_pos = 0;
+	toR->chunk_records_left = 0;
+	return toR;
+}
+
+// Reads the next record into 'r'. Returns 1 on success and 0 at the end of the file or at a chunk that is cut short.
+// A complete chunk that fails its checksum is skipped, the same records getMappedGameRecord refuses.
+int readGameRecord(GameRecordReader* rd, GameRecord* r) {
+	unsigned char header[GAME_RECORD_CHUNK_HEADER_SIZE];
+	int used;
+
+	while (1) {
+		if (rd->chunk_records_left > 0) {
+			used = parseGameRecord(rd->chunk + rd->chunk_pos, rd->chunk_size - rd->chunk_pos, r);
+			if (used > 0) {
+				rd->chunk_pos += used;
+				rd->chunk_records_left--;
+				return 1;
+			}
+			rd->chunk_records_left = 0;      // the rest of the chunk can't be parsed, go to the next one
+			continue;
+		}
+
+		if (fread(header, 1, sizeof(header), rd->f) != sizeof(header) || getU32(header) != GAME_RECORD_CHUNK_MAGIC)
+			return 0;
+		rd->chunk_records_left = getU32(header + 4);
+		rd->chunk_size = getU32(header + 8);
+		rd->chunk_pos = 0;
+		if (rd->chunk_size > GAME_RECORD_CHUNK_SIZE ||
+			fread(rd->chunk, 1, rd->chunk_size, rd->f) != (size_t) rd->chunk_size) {
+			rd->chunk_records_left = 0;
+			return 0;
+		}
+		if (chunkChecksum(rd->chunk, rd->chunk_size) != getU32(header + 12))
+			rd->chunk_records_left = 0;      // damaged, skip it
+	}
+}
+
+void closeGameRecordReader(GameRecordReader* rd) {
+	fclose(rd->f);
+	free(rd->chunk);
+	free(rd);
+}
+
+typedef struct {
+	const unsigned char* data;   // the whole file, mapped read only
+	size_t size;
+	int width;
+	int height;
+	long num_chunks;
+	size_t* chunk_offsets;       // offset of each chunk's payload
+	long* chunk_first_record;    // index of the first record in each chunk
+	char* chunk_checked;         // 0 = checksum not checked yet, 1 = good, 2 = damaged
+	long num_records;            // records in all complete chunks. Checksums are only checked when a chunk is read,
+	                             // so this includes records of damaged chunks, which getMappedGameRecord refuses.
+} MappedGameRecords;      //random access to a game record file through mmap
+
+void unmapGameRecords(MappedGameRecords* m) {
+	munmap((void*) m->data, m->size);
+	free(m->chunk_offsets);
+	free(m->chunk_first_record);
+	free(m->chunk_checked);
+	free(m);
+}
+
+// Maps a game record file and indexes its chunks. Only chunk headers are read here, the pages holding
+// the records are loaded by the OS when getMappedGameRecord touches them. Returns NULL on failure.
+MappedGameRecords* mapGameRecords(const char* path) {
+	struct stat st;
+	size_t pos = GAME_RECORD_HEADER_SIZE;
+	long capacity = 64;
+	int fd = open(path, O_RDONLY);
+	MappedGameRecords* toR;
+
+	if (fd < 0)
+		return NULL;
+	if (fstat(fd, &st) != 0 || st.st_size < GAME_RECORD_HEADER_SIZE) {
+		close(fd);
+		return NULL;
+	}
+
+	toR = (MappedGameRecords*) malloc(sizeof(MappedGameRecords));
+	if (toR == NULL) {
+		close(fd);
+		return NULL;
+	}
+	toR->size = st.st_size;
+	toR->data = (const unsigned char*) mmap(NULL, toR->size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (toR->data == MAP_FAILED) {
+		free(toR);
+		return NULL;
+	}
+
+	toR->num_chunks = 0;
+	toR->num_records = 0;
+	toR->chunk_offsets = (size_t*) malloc(sizeof(size_t) * capacity);
+	toR->chunk_first_record = (long*) malloc(sizeof(long) * capacity);
+	toR->chunk_checked = (char*) malloc(capacity);
+	if (toR->chunk_offsets == NULL || toR->chunk_first_record == NULL || toR->chunk_checked == NULL ||
+		!parseGameRecordHeader(toR->data, &toR->width, &toR->height)) {
+		unmapGameRecords(toR);
+		return NULL;
+	}
+
+	while (pos + GAME_RECORD_CHUNK_HEADER_SIZE <= toR->size && getU32(toR->data + pos) == GAME_RECORD_CHUNK_MAGIC) {
+		long records = getU32(toR->data + pos + 4);
+		size_t payload = getU32(toR->data + pos + 8);
+		if (pos + GAME_RECORD_CHUNK_HEADER_SIZE + payload > toR->size)
+			break;      // chunk cut short, ignore it
+
+		if (toR->num_chunks == capacity) {
+			size_t* offsets = (size_t*) realloc(toR->chunk_offsets, sizeof(size_t) * capacity * 2);
+			if (offsets != NULL)
+				toR->chunk_offsets = offsets;
+			long* first = (long*) realloc(toR->chunk_first_record, sizeof(long) * capacity * 2);
+			if (first != NULL)
+				toR->chunk_first_record = first;
+			char* checked = (char*) realloc(toR->chunk_checked, capacity * 2);
+			if (checked != NULL)
+				toR->chunk_checked = checked;
+			if (offsets == NULL || first == NULL || checked == NULL) {
+				unmapGameRecords(toR);
+				return NULL;
+			}
+			capacity *= 2;
+		}
+		toR->chunk_offsets[toR->num_chunks] = pos + GAME_RECORD_CHUNK_HEADER_SIZE;
+		toR->chunk_first_record[toR->num_chunks] = toR->num_records;
+		toR->chunk_checked[toR->num_chunks] = 0;
+		toR->num_chunks++;
+		toR->num_records += records;
+		pos += GAME_RECORD_CHUNK_HEADER_SIZE + payload;
+	}
+
+	return toR;
+}
+
+// Reads record number 'index' (counting from 0 over the whole file). Returns 0 if it doesn't exist or its
+// chunk is damaged. A chunk's checksum is checked the first time one of its records is read.
+int getMappedGameRecord(MappedGameRecords* m, long index, GameRecord* r) {
+	long lo = 0, hi = m->num_chunks - 1, mid, i;
+	size_t pos, end;
+
+	if (index < 0 || index >= m->num_records)
+		return 0;
+
+	// binary search for the chunk holding the record
+	while (lo < hi) {
+		mid = (lo + hi + 1) / 2;
+		if (m->chunk_first_record[mid] <= index)
+			lo = mid;
+		else
+			hi = mid - 1;
+	}
+
+	pos = m->chunk_offsets[lo];
+	end = pos + getU32(m->data + pos - GAME_RECORD_CHUNK_HEADER_SIZE + 8);
+	if (m->chunk_checked[lo] == 0)
+		m->chunk_checked[lo] = (chunkChecksum(m->data + pos, end - pos) == getU32(m->data + pos - 4) ? 1 : 2);
+	if (m->chunk_checked[lo] != 1)
+		return 0;
+
+	// records have different lengths, so walk to it inside the chunk
+	for (i = m->chunk_first_record[lo]; i <= index; i++) {
+		int used = parseGameRecord(m->data + pos, end - pos, r);
+		if (used == 0)
+			return 0;
+		pos += used;
+	}
+	return 1;
+}
+
+//compares two records field by field
+int isGameRecordEqual(GameRecord* a, GameRecord* b) {
+	int i;
+	if (a->empty_start != b->empty_start || a->start != b->start || a->result != b->result || a->num_moves != b->num_moves)
+		return 0;
+	for (i = 0; i < a->num_moves; i++) {
+		if (a->moves[i].column != b->moves[i].column || a->moves[i].engine != b->moves[i].engine ||
+			a->moves[i].score != b->moves[i].score || a->moves[i].depth != b->moves[i].depth)
+			return 0;
+	}
+	return 1;
+}
+
+//appends games[from..to) to the record file at 'path' in one writer session
+int writeGameRecords(const char* path, GameRecord* games, int from, int to) {
+	GameRecordWriter* w = openGameRecordWriter(path, 7, 6);
+	int g;
+	for (g = from; w != NULL && g < to; g++) {
+		if (!writeGameRecord(w, &games[g]))
+			break;
+	}
+	if (w == NULL || g < to || !closeGameRecordWriter(w)) {
+		fprintf(stderr, "self-test: writing %s failed\n", path);
+		return 0;
+	}
+	return 1;
+}
+
+//appends raw bytes to a file, used to fake what a crash leaves behind
+int appendBytes(const char* path, unsigned char* bytes, size_t size) {
+	FILE* f = fopen(path, "ab");
+	if (f == NULL || fwrite(bytes, 1, size, f) != size || fclose(f) != 0) {
+		fprintf(stderr, "self-test: writing %s failed\n", path);
+		return 0;
+	}
+	return 1;
+}
+
+//streams the file and returns how many records it holds, or -1 if they aren't exactly games[from..to)
+long countMatchingRecords(const char* path, GameRecord* games, int from, int to) {
+	GameRecordReader* rd = openGameRecordReader(path);
+	GameRecord r;
+	long count = 0;
+
+	if (rd == NULL)
+		return -1;
+	while (readGameRecord(rd, &r)) {
+		if (from + count >= to || !isGameRecordEqual(&r, &games[from + count])) {
+			count = -1;
+			break;
+		}
+		count++;
+	}
+	closeGameRecordReader(rd);
+	return count;
+}
+
+// Round trip check for the position encoding and the record file code, run by "--self-test".
+// Plays random 7x6 games, checks every position survives encodePosition/decodePosition, writes the games to
+// 'path' over three writer sessions with a damaged and a cut short chunk left in between, and reads them back
+// with the streaming reader and through mmap. Finally damages the first chunk and checks both readers skip
+// exactly that chunk. Returns 1 if everything matched.
+int checkGameRecordRoundTrip(const char* path) {
+	const int num_games = 3000;
+	GameRecord* games = (GameRecord*) malloc(sizeof(GameRecord) * num_games);
+	GameRecord r;
+	MappedGameRecords* m;
+	FILE* f;
+	unsigned char bad[GAME_RECORD_CHUNK_HEADER_SIZE + 100];
+	int g, i, to_move, player, ok = 0;
+	long first_chunk;
+
+	if (games == NULL)
+		return 0;
+	srand(1);
+
+	// random games, checking the encoding of every position on the way
+	for (g = 0; g < num_games; g++) {
+		GameState* gs = newGameState(7, 6);
+		GameRecord* rec = &games[g];
+		player = 1;
+		rec->empty_start = g % 2;
+		rec->start = 0;
+		if (!rec->empty_start)
+			encodePosition(gs, player, &rec->start);
+		rec->num_moves = 0;
+		rec->result = RECORD_RESULT_UNKNOWN;
+
+		while (!isDraw(gs)) {
+			int column = rand() % 7;
+			if (!canMove(gs, column))
+				continue;
+			drop(gs, column, player);
+			rec->moves[rec->num_moves].column = column;
+			rec->moves[rec->num_moves].engine = rand() % 3;
+			rec->moves[rec->num_moves].score = rand() % 2001 - 1000;
+			rec->moves[rec->num_moves].depth = (rec->moves[rec->num_moves].engine == MOVE_ALPHA_BETA ? rand() % LOOK_AHEAD + 1 : 0);
+			rec->num_moves++;
+
+			unsigned long long code;
+			GameState* decoded;
+			player = 3 - player;
+			if (!encodePosition(gs, player, &code) || (decoded = decodePosition(code, 7, 6, &to_move)) == NULL) {
+				fprintf(stderr, "self-test: position could not be encoded\n");
+				freeGameState(gs);
+				goto done;
+			}
+			i = isGameStateEqual(gs, decoded) && to_move == player;
+			freeGameState(decoded);
+			if (!i) {
+				fprintf(stderr, "self-test: decoded position differs\n");
+				freeGameState(gs);
+				goto done;
+			}
+
+			if (dropWins(gs, column)) {
+				rec->result = 3 - player;
+				break;
+			}
+		}
+		if (rec->result == RECORD_RESULT_UNKNOWN)
+			rec->result = RECORD_RESULT_DRAW;
+		freeGameState(gs);
+	}
+
+	// Three writer sessions. Before the second one a full length chunk whose payload never got written is left
+	// behind, before the third one a chunk cut short, both as if the program had crashed while writing them.
+	// Each session has to cut the bad chunk off before appending.
+	remove(path);
+	if (!writeGameRecords(path, games, 0, num_games / 3))
+		goto done;
+
+	memset(bad, 0, sizeof(bad));
+	putU32(bad, GAME_RECORD_CHUNK_MAGIC);
+	putU32(bad + 4, 5);
+	putU32(bad + 8, sizeof(bad) - GAME_RECORD_CHUNK_HEADER_SIZE);
+	putU32(bad + 12, chunkChecksum(bad, sizeof(bad)) ^ 1);
+	if (!appendBytes(path, bad, sizeof(bad)) || !writeGameRecords(path, games, num_games / 3, 2 * num_games / 3))
+		goto done;
+
+	memset(bad + 16, 0xAB, sizeof(bad) - 16);
+	putU32(bad + 8, 1000);
+	if (!appendBytes(path, bad, sizeof(bad)) || !writeGameRecords(path, games, 2 * num_games / 3, num_games))
+		goto done;
+
+	// streaming read, front to back
+	if (countMatchingRecords(path, games, 0, num_games) != num_games) {
+		fprintf(stderr, "self-test: streaming reader returned wrong records\n");
+		goto done;
+	}
+
+	// random access through mmap, back to front
+	m = mapGameRecords(path);
+	if (m == NULL || m->num_records != num_games || m->num_chunks < 2) {
+		fprintf(stderr, "self-test: mapped file has the wrong number of records\n");
+		if (m != NULL)
+			unmapGameRecords(m);
+		goto done;
+	}
+	for (g = num_games - 1; g >= 0; g--) {
+		if (!getMappedGameRecord(m, g, &r) || !isGameRecordEqual(&r, &games[g]))
+			break;
+	}
+	first_chunk = m->chunk_first_record[1];
+	unmapGameRecords(m);
+	if (g >= 0) {
+		fprintf(stderr, "self-test: mapped record %d differs\n", g);
+		goto done;
+	}
+
+	// Damage one payload byte of the first chunk. Both readers have to skip exactly that chunk.
+	f = fopen(path, "r+b");
+	if (f == NULL || fseeko(f, GAME_RECORD_HEADER_SIZE + GAME_RECORD_CHUNK_HEADER_SIZE + 3, SEEK_SET) != 0 ||
+		fputc(0x5A ^ (int) ((games[0].start >> 24) & 0xFF), f) == EOF || fclose(f) != 0) {
+		fprintf(stderr, "self-test: damaging %s failed\n", path);
+		goto done;
+	}
+	i = (countMatchingRecords(path, games, first_chunk, num_games) == num_games - first_chunk);
+	m = mapGameRecords(path);
+	for (g = 0; i && m != NULL && g < num_games; g++) {
+		int read = getMappedGameRecord(m, g, &r);
+		if (g < first_chunk ? read : (!read || !isGameRecordEqual(&r, &games[g])))
+			i = 0;
+	}
+	if (m == NULL)
+		i = 0;
+	else
+		unmapGameRecords(m);
+	if (!i) {
+		fprintf(stderr, "self-test: the readers didn't skip exactly the damaged chunk\n");
+		goto done;
+	}
+
+	ok = 1;
+
+done:
+	remove(path);
+	free(games);
+	return ok;
+}
+
 // a couple of ease-of-use functions that will run a game in global state
 GameState* globalState;
+GameRecord globalRecord;                  // moves of the current game, for "--record"
+GameRecordWriter* globalRecordWriter = NULL;
+
+//adds a move with its search score to the record of the current game
+void recordMove(int column, int engine, int score, int depth) {
+	if (globalRecordWriter == NULL || globalRecord.num_moves >= RECORD_MAX_MOVES)
+		return;
+	globalRecord.moves[globalRecord.num_moves].column = column;
+	globalRecord.moves[globalRecord.num_moves].engine = engine;
+	globalRecord.moves[globalRecord.num_moves].score = score;
+	globalRecord.moves[globalRecord.num_moves].depth = depth;
+	globalRecord.num_moves++;
+}
+
+// Starts recording the game to 'path'. Must be called right after the game starts. Returns 0 on failure.
+int startRecording(const char* path) {
+	// the game starts on an empty board, which needs no packed start position and so works for every board size
+	globalRecord.empty_start = 1;
+	globalRecord.start = 0;
+	globalRecord.num_moves = 0;
+	globalRecord.result = RECORD_RESULT_UNKNOWN;
+	globalRecordWriter = openGameRecordWriter(path, globalState->width, globalState->height);
+	return globalRecordWriter != NULL;
+}
+
+// Appends the current game to the record file. Registered with atexit because checkWin ends the program.
+void finishRecording() {
+	if (globalRecordWriter == NULL)
+		return;
+
+	// players alternate starting with player 1, so the last move tells who won
+	if (getWinner(globalState))
+		globalRecord.result = (globalRecord.num_moves % 2 ? 1 : 2);
+	else if (isDraw(globalState))
+		globalRecord.result = RECORD_RESULT_DRAW;
+
+	int ok = writeGameRecord(globalRecordWriter, &globalRecord);
+	if (!closeGameRecordWriter(globalRecordWriter))
+		ok = 0;
+	if (!ok)
+		fprintf(stderr, "Could not write the game record\n");
+	globalRecordWriter = NULL;
+}
+
+void startNewGameOfSize(int width, int height) {
+	globalState = newGameState(width, height);
+}
 
 void startNewGame() {
-	globalState = newGameState(7, 6);
+	startNewGameOfSize(7, 6);
 }
 
 void playerMove(int move) {
 	drop(globalState, move, 1);
+	recordMove(move, MOVE_UNSEARCHED, 0, 0);
 }
 
 void computerMove(int look_ahead) {
-	int move = bestMoveForState(globalState, 2, 1, look_ahead);
+	int weight;
+	int move = bestMoveAndWeightForState(globalState, 2, 1, look_ahead, &weight);
 	drop(globalState, move, 2);
+	recordMove(move, MOVE_ALPHA_BETA, weight, look_ahead);
+}
+
+void computerMoveMCTS(MCTSParams* params) {
+	MCTSResult result;
+	int move = mctsBestMoveForState(globalState, 2, 1, params, &result);
+	printf("MCTS: %ld playouts in %.2fs (%.0f playouts/s)\n", result.playouts, result.seconds, result.playouts_per_second);
+	drop(globalState, move, 2);
+	recordMove(move, MOVE_MCTS, result.score, 0);
 }
 
 int isGameWon() {
@@ -701,15 +2301,102 @@ int isEmpty(int x, int y) {
 
 
 int main(int argc, char** argv) {
-	startNewGame();
+	// "--analyze K" shows the K best moves for the player before every turn
+	// "--mcts MS" lets the computer use Monte Carlo tree search for MS milliseconds per move, "--threads N" sets its thread count
+	// "--size W H" plays on a W x H board, both between MIN_BOARD_SIZE and MAX_BOARD_SIZE
+	// "--log LEVEL" (off, error, warn, info, debug) picks which search events are logged, "--log-file PATH" sends them to a file
+	// "--record PATH" appends the game with its search scores to a game record file
+	// "--self-test" checks the position encoding and the game record files, then exits
+	int num_pv = 0;
+	int use_mcts = 0;
+	int width = 7, height = 6;
+	MCTSParams mcts_params = {0, 1000, 1, 1 << 20};
+	int log_level = LOG_WARN;
+	const char* log_path = NULL;
+	const char* record_path = NULL;
+	int i;
+	for (i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--analyze") == 0 && i + 1 < argc) {
+			num_pv = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "--mcts") == 0 && i + 1 < argc) {
+			use_mcts = 1;
+			mcts_params.time_ms = atoi(argv[++i]);
+			if (mcts_params.time_ms <= 0) {
+				fprintf(stderr, "--mcts needs a time in milliseconds greater than 0\n");
+				return 1;
+			}
+		} else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+			mcts_params.threads = atoi(argv[++i]);
+			if (mcts_params.threads < 1 || mcts_params.threads > MCTS_MAX_THREADS) {
+				fprintf(stderr, "--threads must be between 1 and %d\n", MCTS_MAX_THREADS);
+				return 1;
+			}
+		} else if (strcmp(argv[i], "--size") == 0 && i + 2 < argc) {
+			width = atoi(argv[++i]);
+			height = atoi(argv[++i]);
+			if (width < MIN_BOARD_SIZE || width > MAX_BOARD_SIZE || height < MIN_BOARD_SIZE || height > MAX_BOARD_SIZE) {
+				fprintf(stderr, "--size needs a width and height between %d and %d\n", MIN_BOARD_SIZE, MAX_BOARD_SIZE);
+				return 1;
+			}
+		} else if (strcmp(argv[i], "--log") == 0 && i + 1 < argc) {
+			i++;
+			for (log_level = LOG_DEBUG; log_level > LOG_OFF; log_level--) {
+				if (strcasecmp(argv[i], logLevelNames[log_level]) == 0)
+					break;
+			}
+			if (log_level == LOG_OFF && strcasecmp(argv[i], "off") != 0) {
+				fprintf(stderr, "Unknown log level %s, use off, error, warn, info or debug\n", argv[i]);
+				return 1;
+			}
+		} else if (strcmp(argv[i], "--log-file") == 0 && i + 1 < argc) {
+			log_path = argv[++i];
+		} else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+			record_path = argv[++i];
+		} else if (strcmp(argv[i], "--self-test") == 0) {
+			char path[] = "/tmp/connect4-selftest-XXXXXX";
+			int fd = mkstemp(path);
+			if (fd < 0) {
+				fprintf(stderr, "Could not create a temporary file\n");
+				return 1;
+			}
+			close(fd);
+			if (!checkGameRecordRoundTrip(path))
+				return 1;
+			printf("Game record self-test passed\n");
+			return 0;
+		}
+	}
+
+	if (!startLogging(log_level, (log_path != NULL ? LOG_SINK_FILE : LOG_SINK_STDERR), log_path))
+		fprintf(stderr, "Could not start logging\n");
+	atexit(stopLogging);   // checkWin exits the program, flush the log then
+
+	startNewGameOfSize(width, height);
+	if (globalState == NULL) {
+		fprintf(stderr, "Out of memory\n");
+		return 1;
+	}
+	if (record_path != NULL) {
+		if (!startRecording(record_path))
+			return 1;
+		atexit(finishRecording);
+	}
 
 	while (1) {
 		// Print the empty board before asking for user input
 		printGameState(globalState);
 
+		if (num_pv > 0) {
+			RootMoveAnalysis* analysis = (RootMoveAnalysis*) malloc(sizeof(RootMoveAnalysis) * num_pv);
+			int count = analyzeState(globalState, 1, 2, LOOK_AHEAD, num_pv, analysis);
+			printAnalysis(analysis, count);
+			free(analysis);
+		}
+
 		int move;
-		printf("You can start from column 0 to 6. Choose which column you want to start with: ");
-		scanf("%d", &move);
+		printf("You can start from column 0 to %d. Choose which column you want to start with: ", globalState->width - 1);
+		if (scanf("%d", &move) != 1)
+			break;     // input ended or wasn't a number, stop the game
 
 		if (move < 0 || move >= globalState->width || !canMove(globalState, move)) {
 			printf("Invalid move. Please choose a valid column.\n");
@@ -722,13 +2409,17 @@ int main(int argc, char** argv) {
 
 		checkWin(globalState);
 
-		computerMove(LOOK_AHEAD);
+		if (use_mcts)
+			computerMoveMCTS(&mcts_params);
+		else
+			computerMove(LOOK_AHEAD);
 
 		printGameState(globalState);
 
 		checkWin(globalState);
 	}
 
+	finishRecording();
 	freeGameState(globalState);
 
 	return 0;